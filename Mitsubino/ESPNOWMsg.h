@@ -102,12 +102,25 @@ class ESPNOWStateMachine : public CRTPStateMachine<ESPNOWStateMachine, ESPNOWSta
   const bool wifiConnection_;
   String sendBuffer_;
   size_t numAttempts_{};
+  unsigned long sendStart_{};
+  // set by the receive callback, histograms are only recorded from loopImpl
+  static constexpr uint32_t NO_ACK = UINT32_MAX;
+  std::atomic<uint32_t> ackRtt_{NO_ACK};
 
   std::vector<ReceivedMessage> receivedMessages_;
 
   static ESPNOWStateMachine* singleton_;
   using CRTPStateMachine::state_t;
 
+  static Counter tx_metric_;
+  static Counter tx_failed_metric_;
+  static Counter rx_metric_;
+  static Counter rx_discarded_metric_;
+  static Counter retry_metric_;
+  static Counter dropped_metric_;
+  static Counter channel_hop_metric_;
+  static Histogram<9> ack_rtt_metric_;
+
 
 public:
   static constexpr const char* name = "ESPNOW";
@@ -117,6 +130,10 @@ public:
     return numAttempts_;
   }
 
+  const FixedString<16>& hostname() const {
+    return my_hostname_;
+  }
+
   ESPNOWStateMachine(Logger* logger, String my_hostname, bool wifiConnection, int initialChannel) 
     : logger_{logger}, my_hostname_(my_hostname), wifiConnection_(wifiConnection) {
     // save for comms protocol
@@ -162,6 +179,9 @@ public:
   }
 
   void loopImpl() {
+    uint32_t rtt = ackRtt_.exchange(NO_ACK);
+    if (rtt != NO_ACK)
+      ack_rtt_metric_.observe(rtt);
     switch (state()) {
       case state_t::CONNECTING:
         if (wifiConnection_ && WiFi.status() == WL_CONNECTED) {
@@ -174,26 +194,36 @@ public:
           // if we are running with boot-and-send, make sure we have a channel locked
           transition(state_t::READY_NO_ACK);
         }
+        else {
+          wake_in(10);
+        }
         break;
       case state_t::TRANSMIT:
         esp_now_send(ESP_NOW_BROADCAST_MAC, (const uint8_t*)sendBuffer_.begin(), sendBuffer_.length());
+        tx_metric_.inc();
+        if (numAttempts_ > 0)
+          retry_metric_.inc();
         numAttempts_++;
         transition(state_t::WAIT_ACK);
         break;
       case state_t::WAIT_ACK:
         // timeout waiting for an ack. successful ack handled in on_data_received.
-        if (time_in_state() > 200) {
+        if (in_state_for(200)) {
           if (!wifiConnection_) {
             setNextChannel();
             transition(state_t::NEXT_CHANNEL);
           }
+          else if (numAttempts_ < 10) {
+            transition(state_t::TRANSMIT);
+          }
           else {
-            transition(numAttempts_ < 10 ? state_t::TRANSMIT : state_t::FAILED);
+            dropped_metric_.inc();
+            transition(state_t::FAILED);
           }
         }
         break;
       case state_t::NEXT_CHANNEL:
-        if (time_in_state() > 4) {
+        if (in_state_for(5)) {
           transition(state_t::TRANSMIT);
         }
         break;
@@ -201,6 +231,7 @@ public:
       case state_t::READY_NO_ACK:
       case state_t::FAILED:
         // waiting for a sendMessage call
+        wait_for_event();
         break;
     }
   }
@@ -216,6 +247,7 @@ public:
     sendBuffer_ = std::move(msg);
     esp_now_manual_xor(sendBuffer_);
     numAttempts_ = 0;
+    sendStart_ = millis();
     transition(state_t::TRANSMIT);
   }
 
@@ -223,6 +255,7 @@ public:
     // fire-and-forget, we're not waiting for a response here
     esp_now_manual_xor(msg);
     esp_now_send(ESP_NOW_BROADCAST_MAC, (const uint8_t*)msg.begin(), msg.length());
+    tx_metric_.inc();
   }
 
   bool hasReceived() const {
@@ -235,6 +268,12 @@ public:
     return recv;
   }
 
+  // the ESP-NOW callbacks carry no context, so they go to the most recently created
+  // instance; the host simulator runs several nodes in one process and rebinds them
+  void bindCallbacks() {
+    singleton_ = this;
+  }
+
   int getChannel() {
     uint8_t chan;
     wifi_second_chan_t chan2;
@@ -253,6 +292,7 @@ public:
     int channel = getChannel();
     auto it = std::find(WIFI_CHANNELS.begin(), WIFI_CHANNELS.end(), channel);
     int nextIndex = (it - WIFI_CHANNELS.begin()) + 1;
+    channel_hop_metric_.inc();
     setChannel(WIFI_CHANNELS[(nextIndex+1) % WIFI_CHANNELS.size()]);
   }
 
@@ -261,12 +301,14 @@ private:
     ReceivedMessage msg{ReceivedMessage::Type::Unset, std::move(message)};
     if (msg->version != MsgHeader::VERSION) {
       logger_->println("Discarding packet due to version mismatch, got ", msg->version, " but expected ", MsgHeader::VERSION);
+      rx_discarded_metric_.inc();
       return;
     }
     bool isForMe = msg->recipient == my_hostname_;
     bool isBroadcast = msg->recipient == BROADCAST_HOSTNAME;
     if (!(isForMe || isBroadcast)) {
       logger_->println("Discarding packet because recipient is ", msg->recipient, " but expected ", my_hostname_);
+      rx_discarded_metric_.inc();
       return;
     }
     MsgHeader* sentMsg = sendBuffer_.length() ? (MsgHeader*)sendBuffer_.begin() : nullptr;
@@ -280,6 +322,7 @@ private:
           logger_->println("Error: received unexpected message, code: ", correctState, correctSend);
         }
         sendBuffer_.clear();
+        ackRtt_.store(millis() - sendStart_);
         transition(state_t::CONNECTED);
       }
       else {
@@ -295,14 +338,27 @@ private:
 
   static void onDataSent(const esp_now_send_info_t *tx_info, esp_now_send_status_t status) {
     // it's assumed that this will succeed
+    if (status != ESP_NOW_SEND_SUCCESS)
+      tx_failed_metric_.inc();
     ESPNOWStateMachine::singleton_->logger_->println("Packet send status: ", (status == ESP_NOW_SEND_SUCCESS) ? "success" : "failure");
   }
 
   static void onDataReceived(const esp_now_recv_info_t *rx_info, const uint8_t *incomingData, int len) {
+    rx_metric_.inc();
     String msg((const char*)incomingData, len);
     esp_now_manual_xor(msg);
     ESPNOWStateMachine::singleton_->onReceive(std::move(msg));
+    // wake the loop even if this wasn't an ACK, there may be a message to handle
+    ESPNOWStateMachine::singleton_->notify();
   }
 };
 
 ESPNOWStateMachine* ESPNOWStateMachine::singleton_ = nullptr;
+Counter ESPNOWStateMachine::tx_metric_{"mitsubino_espnow_tx_total", "ESP-NOW frames handed to the radio"};
+Counter ESPNOWStateMachine::tx_failed_metric_{"mitsubino_espnow_tx_failed_total", "ESP-NOW frames the radio reported as failed"};
+Counter ESPNOWStateMachine::rx_metric_{"mitsubino_espnow_rx_total", "ESP-NOW frames received"};
+Counter ESPNOWStateMachine::rx_discarded_metric_{"mitsubino_espnow_rx_discarded_total", "ESP-NOW frames discarded for version or recipient"};
+Counter ESPNOWStateMachine::retry_metric_{"mitsubino_espnow_retries_total", "ESP-NOW retransmissions after an ACK timeout"};
+Counter ESPNOWStateMachine::dropped_metric_{"mitsubino_espnow_dropped_total", "ESP-NOW messages given up on after too many attempts"};
+Counter ESPNOWStateMachine::channel_hop_metric_{"mitsubino_espnow_channel_hops_total", "ESP-NOW channel changes while searching for the relay"};
+Histogram<9> ESPNOWStateMachine::ack_rtt_metric_{"mitsubino_espnow_ack_rtt_ms", "Time from sendMessage to matching response", {5, 10, 20, 50, 100, 200, 500, 1000, 2000}};
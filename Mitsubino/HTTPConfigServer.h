@@ -7,7 +7,10 @@
 #endif
 
 #include "Logger.h"
+#include "Metrics.h"
+#include "Profiler.h"
 #include "PersistentData.h"
+#include "States.h"
 
 /* Root page */
 const char ROOT_PAGE_BODY[] PROGMEM = R"=====(
@@ -15,12 +18,15 @@ const char ROOT_PAGE_BODY[] PROGMEM = R"=====(
 ESP8266/32 Mitsubino Server version 1.1.0:<br>
 <a href="config">Configuration</a><br>
 <a href="log">View log</a><br>
+<a href="metrics">Metrics</a><br>
+<a href="profile">Loop profile</a><br>
 <a href="restart">Restart</a><br>
 <a href="blink">Blink LED</a>
 </p></body></html>
 )=====";
 
-/* Auto-refreshing webpage that fetches latest debug log every 2s */
+/* Auto-refreshing webpage that fetches new debug log lines every 2s.
+   Keeps its own cursor so any number of viewers can tail the log at once. */
 const char LOG_PAGE_BODY[] PROGMEM = R"=====(
 <!DOCTYPE html><html>
 <div style="white-space: pre-line"><p>
@@ -28,22 +34,98 @@ ESP debug log:<br>
 <span id="log_text"><br></span>
 </p></div>
 <script>
+var cursor = 0;
 setInterval(getData, 2000);
 function getData() {
   var xhttp = new XMLHttpRequest();
   xhttp.onreadystatechange = function() {
     if (this.readyState == 4 && this.status == 200) {
-      document.getElementById("log_text").innerHTML += this.responseText;
+      cursor = this.getResponseHeader("X-Log-Cursor") || cursor;
+      if (this.responseText.length)
+        document.getElementById("log_text").appendChild(document.createTextNode(this.responseText));
     }
   };
-  xhttp.open("GET", "get_log", true);
+  xhttp.open("GET", "get_log?since=" + cursor, true);
   xhttp.send();
 }
 </script>
 </body></html>
 )=====";
 
-class HTTPConfigServer {
+// Fills a small fixed buffer and sends it out as an HTTP chunk whenever it runs full,
+// so dynamic pages never get assembled in one big heap String. Also usable as a Print.
+template <typename Server, size_t N = 256>
+class ChunkedResponse : public Print {
+  Server& server_;
+  char buffer_[N];
+  size_t len_{0};
+
+  void append(const char* s, size_t len) {
+    while (len) {
+      size_t n = std::min(len, N - len_);
+      memcpy(buffer_ + len_, s, n);
+      len_ += n;
+      s += n;
+      len -= n;
+      if (len_ == N)
+        flush();
+    }
+  }
+
+  void print_impl(const char* s) {
+    append(s, strlen(s));
+  }
+
+  void print_impl(const String& s) {
+    append(s.c_str(), s.length());
+  }
+
+  // numbers etc, short enough to fit in String's inline storage
+  template<typename T>
+  void print_impl(const T& t) {
+    print_impl(String(t));
+  }
+
+  template<typename T, typename... U>
+  void print_impl(const T& t, const U&... u) {
+    print_impl(t);
+    print_impl(u...);
+  }
+
+public:
+  ChunkedResponse(Server& server, int code, const char* content_type) : server_(server) {
+    server_.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server_.send(code, content_type, "");
+  }
+
+  ~ChunkedResponse() {
+    flush();
+    server_.sendContent("");
+  }
+
+  void flush() override {
+    if (len_)
+      server_.sendContent(buffer_, len_);
+    len_ = 0;
+  }
+
+  size_t write(uint8_t c) override {
+    append((const char*)&c, 1);
+    return 1;
+  }
+
+  size_t write(const uint8_t* buf, size_t len) override {
+    append((const char*)buf, len);
+    return len;
+  }
+
+  template<typename... T>
+  void print(const T&... t) {
+    print_impl(t...);
+  }
+};
+
+class HTTPConfigServer : public ScheduledTask {
   #ifdef ESP8266
   ESP8266WebServer server_{80};
   #else
@@ -53,29 +135,25 @@ class HTTPConfigServer {
   Logger* logger_;
   PersistentData* persistent_data_;
 
+  static LoopSection loop_section_;
+
 public:
   HTTPConfigServer(Logger* logger, PersistentData* persistent_data) : logger_{logger}, persistent_data_{persistent_data} {
-    server_.on("/", [this] () { server_.send(200, "text/html", String(ROOT_PAGE_BODY)); });
+    server_.on("/", [this] () { server_.send_P(200, "text/html", ROOT_PAGE_BODY); });
     server_.on("/config", [this] () { handle_persistent_forms(); });
     server_.on("/save", [this] () { handle_persistent_save(); });
-    server_.on("/log", [this] () { server_.send(200, "text/html", String(LOG_PAGE_BODY)); });
-    server_.on("/get_log", [this] () {
-      server_.send(200, "text/plain", logger_->get());
-      logger_->clear();
+    server_.on("/log", [this] () { server_.send_P(200, "text/html", LOG_PAGE_BODY); });
+    server_.on("/get_log", [this] () { handle_get_log(); });
+    server_.on("/metrics", [this] () {
+      ChunkedResponse<decltype(server_)> out(server_, 200, "text/plain; version=0.0.4");
+      Metric::write_all(out);
     });
-    server_.on("/restart", [this] () { server_.send(200, "text/plain", "Restarting..."); ESP.restart(); });
-    server_.onNotFound([this]() {
-      String message = "File Not Found\n\n";
-      message += "URI: ";
-      message += server_.uri();
-      message += "\nMethod: ";
-      message += (server_.method() == HTTP_GET) ? "GET" : "POST";
-      message += "\nArguments: ";
-      message += server_.args();
-      message += "\n";
-      for (uint8_t i = 0; i < server_.args(); i++) { message += " " + server_.argName(i) + ": " + server_.arg(i) + "\n"; }
-      server_.send(404, "text/plain", message);
+    server_.on("/profile", [this] () {
+      ChunkedResponse<decltype(server_)> out(server_, 200, "text/plain");
+      LoopProfiler::dump(out, server_.hasArg("reset"));
     });
+    server_.on("/restart", [this] () { server_.send(200, "text/plain", "Restarting..."); ESP.restart(); });
+    server_.onNotFound([this]() { handle_not_found(); });
     server_.begin();
   }
 
@@ -83,19 +161,50 @@ public:
     server_.handleClient();
   }
 
+protected:
+  void run() override {
+    ScopedTimer timer(loop_section_);
+    loop();
+    wake_in(POLL_MS);
+  }
+
 private:
 
+  // Sends log lines after the client's cursor as a chunked response, straight out of
+  // the logger's ring buffer. The new cursor comes back in the X-Log-Cursor header.
+  void handle_get_log() {
+    uint32_t since = server_.hasArg("since") ? server_.arg("since").toInt() : 0;
+    // stop at the cursor we hand out, lines logged meanwhile go out next time
+    uint32_t until = logger_->cursor();
+    server_.sendHeader("X-Log-Cursor", String(until));
+    server_.sendHeader("Cache-Control", "no-cache");
+    server_.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server_.send(200, "text/plain", "");
+    logger_->read_since(since, [this](const char* s, size_t len) { server_.sendContent(s, len); }, until);
+    server_.sendContent("");
+  }
+
+  void handle_not_found() {
+    ChunkedResponse<decltype(server_)> out(server_, 404, "text/plain");
+    out.print("File Not Found\n\nURI: ", server_.uri());
+    out.print("\nMethod: ", (server_.method() == HTTP_GET) ? "GET" : "POST");
+    out.print("\nArguments: ", server_.args(), "\n");
+    for (int i = 0; i < server_.args(); i++) {
+      out.print(" ", server_.argName(i), ": ", server_.arg(i), "\n");
+    }
+  }
+
   // Shows webpage that displays forms to submit
   void handle_persistent_forms() {
+    ChunkedResponse<decltype(server_)> out(server_, 200, "text/html");
     // use whatever we have saved to try and prepopulate the fields
-    String content = F("<!DOCTYPE HTML>\r\n<html>Mitsubino Connectivity Setup <form method='get' action='save'>");
+    out.print("<!DOCTYPE HTML>\r\n<html>Mitsubino Connectivity Setup <form method='get' action='save'>");
     for (size_t i = 0; i < PersistentData::NumFields; i++) {
-      content += "<label>" + String(PersistentData::FieldNames[i]) + ": </label>";
-      content += "<input name = '" + String(PersistentData::FieldNames[i]) + "' ";
-      content += " value = '" + persistent_data_->fields()[i] + "' length=64><br>";
+      out.print("<label>", PersistentData::FieldNames[i], ": </label>");
+      out.print("<input name = '", PersistentData::FieldNames[i], "' ");
+      out.print(" value = '", persistent_data_->fields()[i], "' length=64><br>");
     }
-    content += "<input type='submit'></form></html>";
-    server_.send(200, "text/html", content);
+    out.print("<input type='submit'></form></html>");
   }
 
   // Saves the resulting POST from form submission
@@ -105,15 +214,17 @@ private:
       data.fields()[i] = server_.arg(PersistentData::FieldNames[i]);
     if (data.my_hostname.length() > 16) {
       logger_->println("Error: requested hostname ", data.my_hostname, " is longer than 16 characters!");
-      server_.send(200, "text/html", F("Error: requested parameters are not valid. See log for details."));
+      server_.send_P(200, "text/html", PSTR("Error: requested parameters are not valid. See log for details."));
       return;
     }
     logger_->println("Received data from POST and saving to Flash:");
     data.print();
     data.save();
-    server_.send(200, "text/html", F("Data saved, rebooting. You may need to change networks or addresses to reconnect."));
+    server_.send_P(200, "text/html", PSTR("Data saved, rebooting. You may need to change networks or addresses to reconnect."));
     logger_->println("Rebooting...");
     delay(1000);
     ESP.restart();
   }
-};
\ No newline at end of file
+};
+
+LoopSection HTTPConfigServer::loop_section_{"HTTP"};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <Arduino.h>
+#include <memory>
+#include <mutex>
 
 template <size_t N>
 struct FixedString {
@@ -29,19 +31,64 @@ struct FixedString {
   constexpr auto operator<=>(const FixedString&) const = default;
 };
 
+// Log records live in a fixed ring buffer of characters, one record per line.
+// Every completed line gets a sequence number, so readers keep their own cursor
+// and ask for everything after it instead of draining a shared buffer.
+// Safe to use from several tasks, readers only hold the lock while copying small pieces.
 class Logger {
-  String buffer_;
+  mutable std::mutex mutex_;
+  std::unique_ptr<char[]> ring_;
   const size_t capacity_;
+  size_t head_{0};      // next write position
+  size_t size_{0};      // bytes currently held
+  size_t pending_{0};   // bytes of the trailing line that has no newline yet
+  uint32_t written_{0}; // bytes ever written, readers track absolute offsets against this
+  uint32_t first_seq_{0};
+  uint32_t next_seq_{0};
   bool use_serial_{false};
 
+  size_t tail() const {
+    return (head_ + capacity_ - size_) % capacity_;
+  }
+
+  // make room by dropping the oldest complete line
+  void drop_oldest() {
+    if (first_seq_ == next_seq_) {
+      // buffer holds only a single unterminated line, eat into it
+      size_--;
+      pending_--;
+      return;
+    }
+    char c;
+    do {
+      c = ring_[tail()];
+      size_--;
+    } while (c != '\n');
+    first_seq_++;
+  }
+
+  void write(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      if (size_ == capacity_)
+        drop_oldest();
+      ring_[head_] = s[i];
+      head_ = (head_ + 1) % capacity_;
+      size_++;
+      written_++;
+      if (s[i] == '\n') {
+        next_seq_++;
+        pending_ = 0;
+      }
+      else {
+        pending_++;
+      }
+    }
+  }
+
   template<typename T>
   void print_impl(const T& t) {
     String s(t);
-    if (s.length() + buffer_.length() >= (capacity_-1)) {
-      clear();
-      buffer_.concat("-- truncated --\n");
-    }
-    buffer_.concat(s);
+    write(s.c_str(), s.length());
     if (use_serial_)
       Serial.print(s);
   }
@@ -58,24 +105,83 @@ class Logger {
   }
 
 public:
-  Logger(size_t capacity) : capacity_(capacity) {
-    buffer_.reserve(capacity);
-  }
+  Logger(size_t capacity) : ring_(new char[capacity]), capacity_(capacity) {}
 
   void set_serial(bool use_serial) {
     use_serial_ = use_serial;
   }
 
-  void clear() {
-    buffer_.remove(0, buffer_.length());
+  // sequence number that the next completed line will get
+  uint32_t cursor() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_seq_;
   }
 
-  const String& get() {
-    return buffer_;
+  // Hands every complete line with since <= sequence number < until to sink(const char*, size_t)
+  // and returns the cursor to pass next time. Data is copied out in small pieces so
+  // writers are never held up by a slow sink. since = 0 is a new reader and starts at
+  // the oldest line we still have. A cursor that has already been
+  // overwritten (or is from before a reboot) gets a truncation marker and resumes at
+  // the oldest line we still have; so does a reader that gets lapped mid-read.
+  template<typename F>
+  uint32_t read_since(uint32_t since, F&& sink, uint32_t until = UINT32_MAX) const {
+    static const char marker[] = "-- truncated --\n";
+    char chunk[128];
+    uint32_t pos, end, next;
+    bool truncated = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (since == 0) {
+        since = first_seq_;
+      }
+      else if (since < first_seq_ || since > next_seq_) {
+        truncated = true;
+        since = first_seq_;
+      }
+      next = std::max(since, std::min(until, next_seq_));
+      size_t p = tail();
+      pos = written_ - size_;
+      end = pos;
+      for (uint32_t seq = first_seq_; seq < next; seq++) {
+        char c;
+        do {
+          c = ring_[p];
+          p = (p + 1) % capacity_;
+          end++;
+        } while (c != '\n');
+        if (seq + 1 == since)
+          pos = end;
+      }
+    }
+    if (truncated)
+      sink(marker, sizeof(marker) - 1);
+    while (pos != end) {
+      size_t n = std::min<size_t>(sizeof(chunk), end - pos);
+      bool lapped = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (written_ - pos > size_) {
+          lapped = true;
+        }
+        else {
+          size_t p = (head_ + capacity_ - (written_ - pos)) % capacity_;
+          for (size_t i = 0; i < n; i++)
+            chunk[i] = ring_[(p + i) % capacity_];
+        }
+      }
+      if (lapped) {
+        sink(marker, sizeof(marker) - 1);
+        break;
+      }
+      sink(chunk, n);
+      pos += n;
+    }
+    return next;
   }
 
   template<typename... T>
   void print(const T&... t) {
+    std::lock_guard<std::mutex> lock(mutex_);
     print_impl(t...);
   }
 
@@ -12,6 +12,13 @@ enum class MQTTStates : int {
   CONNECTED,
 };
 
+// a publish or received message, fixed size so it can go through a MessageQueue
+struct MQTTMessage {
+  FixedString<64> topic;
+  FixedString<512> payload;
+  bool retain{false};
+};
+
 //  bool connect() {
 //    g_mqtt_client.setCallback(handle_mqtt_message);
 //    g_mqtt_client.subscribe(get_topic_name("control").c_str());
@@ -25,6 +32,11 @@ class MQTTStateMachine : public CRTPStateMachine<MQTTStateMachine, MQTTStates> {
   const String username_;
   const String password_;
   Logger* logger_;
+  std::vector<String> subscriptions_;
+
+  static Counter connect_metric_;
+  static Counter connect_failed_metric_;
+  static Counter publish_failed_metric_;
 
 public:
   using CRTPStateMachine::state_t;
@@ -40,6 +52,18 @@ public:
   static constexpr const char* name = "MQTT";
   static constexpr state_t initial_state = state_t::DISCONNECTED;
 
+  // topics to (re)subscribe to every time we connect; call before the network is running
+  void subscribe(const String& topic) {
+    subscriptions_.push_back(topic);
+  }
+
+  bool publish(const char* topic, const char* payload, bool retained) {
+    if (state() == state_t::CONNECTED && client.publish(topic, payload, retained))
+      return true;
+    publish_failed_metric_.inc();
+    return false;
+  }
+
 private:
   void disconnect() {
     client.disconnect();
@@ -50,13 +74,16 @@ public:
   void loopImpl() {
     switch (state()) {
       case state_t::CONNECTED:
-        if (WiFi.status() != WL_CONNECTED || !client.connected())
+        if (WiFi.status() != WL_CONNECTED || !client.connected()) {
           disconnect();
-        else
+        }
+        else {
           client.loop();
+          wake_in(POLL_MS);
+        }
         return;
       case state_t::CONNECTING:
-        if (time_in_state() < 200)
+        if (!in_state_for(200))
           return;
         if (WiFi.status() != WL_CONNECTED) {
           disconnect();
@@ -64,19 +91,31 @@ public:
         }
         if (client.connect(hostname_.c_str(), username_.c_str(), password_.c_str())) {
           logger_->println("MQTT connected");
+          connect_metric_.inc();
+          for (const String& topic : subscriptions_) {
+            if (!client.subscribe(topic.c_str()))
+              logger_->println("MQTT failed to subscribe to ", topic);
+          }
           transition(state_t::CONNECTED);
         }
         else {
           logger_->println("MQTT client failed to connect, state: ", client.state());
+          connect_failed_metric_.inc();
           disconnect();
         }
         return;
       case state_t::DISCONNECTED:
-        if (time_in_state() < 100)
+        if (!in_state_for(100))
           return;
         if (WiFi.status() == WL_CONNECTED)
           transition(state_t::CONNECTING);
+        else
+          wake_in(100);
         return;
     }
   }
 };
+
+Counter MQTTStateMachine::connect_metric_{"mitsubino_mqtt_connects_total", "Successful MQTT (re)connections"};
+Counter MQTTStateMachine::connect_failed_metric_{"mitsubino_mqtt_connect_failures_total", "Failed MQTT connection attempts"};
+Counter MQTTStateMachine::publish_failed_metric_{"mitsubino_mqtt_publish_failures_total", "MQTT publishes that were dropped or rejected"};
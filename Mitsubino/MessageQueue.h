@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+/// Lock-free single producer, single consumer queue of fixed-size messages, for
+/// handing work between the two cores in dual core mode. Holds N-1 messages;
+/// push() fails rather than blocking or allocating when the queue is full.
+template <typename T, size_t N>
+class MessageQueue {
+  std::array<T, N> slots_{};
+  std::atomic<size_t> head_{0};  // next slot to write, only moved by the producer
+  std::atomic<size_t> tail_{0};  // next slot to read, only moved by the consumer
+
+public:
+  bool push(const T& msg) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t next = (head + 1) % N;
+    if (next == tail_.load(std::memory_order_acquire))
+      return false;
+    slots_[head] = msg;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& msg) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+      return false;
+    msg = slots_[tail];
+    tail_.store((tail + 1) % N, std::memory_order_release);
+    return true;
+  }
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+#include <atomic>
+
+/// Counters, gauges and histograms for the /metrics page, in Prometheus text format.
+/// Every metric is a statically allocated object that links itself into a global
+/// list when constructed, so neither recording nor exporting ever allocates.
+/// Metrics that share a name (eg the same counter with different labels) are
+/// grouped under a single HELP/TYPE header on export.
+class Metric {
+  static Metric* head_;
+  Metric* next_;
+
+protected:
+  Metric(const char* name, const char* help, const char* type) : next_(head_), name(name), help(help), type(type) {
+    head_ = this;
+  }
+
+public:
+  const char* const name;
+  const char* const help;
+  const char* const type;
+
+  Metric(const Metric&) = delete;
+  Metric& operator=(const Metric&) = delete;
+
+  // one or more "name{labels} value\n" lines
+  virtual void write_samples(Print& out) const = 0;
+
+  static void write_all(Print& out) {
+    for (const Metric* m = head_; m; m = m->next_) {
+      // already written out together with an earlier metric of the same name
+      bool seen = false;
+      for (const Metric* p = head_; p != m && !seen; p = p->next_)
+        seen = !strcmp(p->name, m->name);
+      if (seen)
+        continue;
+      out.print("# HELP "); out.print(m->name); out.print(' '); out.print(m->help); out.print('\n');
+      out.print("# TYPE "); out.print(m->name); out.print(' '); out.print(m->type); out.print('\n');
+      for (const Metric* s = m; s; s = s->next_) {
+        if (!strcmp(s->name, m->name))
+          s->write_samples(out);
+      }
+    }
+  }
+};
+Metric* Metric::head_ = nullptr;
+
+// safe to bump from the ESP-NOW/WiFi callbacks
+class Counter : public Metric {
+  std::atomic<uint32_t> value_{0};
+
+public:
+  Counter(const char* name, const char* help) : Metric(name, help, "counter") {}
+
+  void inc(uint32_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint32_t value() const {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+  void write_samples(Print& out) const override {
+    out.print(name); out.print(' '); out.print(value()); out.print('\n');
+  }
+};
+
+// either set() directly, or given a function that is sampled on export
+class Gauge : public Metric {
+  std::atomic<int32_t> value_{0};
+  int32_t (*const sample_)();
+
+public:
+  Gauge(const char* name, const char* help, int32_t (*sample)() = nullptr) : Metric(name, help, "gauge"), sample_(sample) {}
+
+  void set(int32_t v) {
+    value_.store(v, std::memory_order_relaxed);
+  }
+
+  int32_t value() const {
+    return sample_ ? sample_() : value_.load(std::memory_order_relaxed);
+  }
+
+  void write_samples(Print& out) const override {
+    out.print(name); out.print(' '); out.print(value()); out.print('\n');
+  }
+};
+
+// fixed upper bucket bounds, observations above the last bound only land in +Inf.
+// optionally carries a single label, eg section="ESPNOW". Not atomic, only observe from tasks, not callbacks
+template <size_t N>
+class Histogram : public Metric {
+  const std::array<uint32_t, N> bounds_;
+  std::array<uint32_t, N+1> counts_{};
+  uint64_t sum_{0};
+  const char* const label_name_;
+  const char* const label_value_;
+
+  void write_name(Print& out, const char* suffix, bool more_labels) const {
+    out.print(name); out.print(suffix);
+    if (label_name_) {
+      out.print('{'); out.print(label_name_); out.print("=\""); out.print(label_value_); out.print('"');
+      out.print(more_labels ? "," : "}");
+    }
+    else if (more_labels) {
+      out.print('{');
+    }
+  }
+
+public:
+  Histogram(const char* name, const char* help, const std::array<uint32_t, N>& bounds, const char* label_name = nullptr, const char* label_value = nullptr)
+    : Metric(name, help, "histogram"), bounds_(bounds), label_name_(label_name), label_value_(label_value) {}
+
+  uint32_t count() const {
+    uint32_t total = 0;
+    for (uint32_t c : counts_)
+      total += c;
+    return total;
+  }
+
+  uint64_t sum() const {
+    return sum_;
+  }
+
+  void observe(uint32_t v) {
+    size_t i = 0;
+    while (i < N && v > bounds_[i])
+      i++;
+    counts_[i]++;
+    sum_ += v;
+  }
+
+  void write_samples(Print& out) const override {
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i <= N; i++) {
+      cumulative += counts_[i];
+      write_name(out, "_bucket", true);
+      out.print("le=\"");
+      if (i < N)
+        out.print(bounds_[i]);
+      else
+        out.print("+Inf");
+      out.print("\"} "); out.print(cumulative); out.print('\n');
+    }
+    write_name(out, "_sum", false);
+    out.print(' '); out.print(sum_); out.print('\n');
+    write_name(out, "_count", false);
+    out.print(' '); out.print(cumulative); out.print('\n');
+  }
+};
+
+// total milliseconds spent in each state of one state machine, labelled by machine and state
+class StateTimeMetric : public Metric {
+public:
+  static constexpr size_t MAX_STATES = 8;
+
+private:
+  const char* const machine_;
+  std::array<uint64_t, MAX_STATES> ms_{};
+
+public:
+  StateTimeMetric(const char* machine) : Metric("mitsubino_state_time_ms_total", "Milliseconds spent in each state machine state", "counter"), machine_(machine) {}
+
+  void add(int state, uint32_t ms) {
+    if (state >= 0 && (size_t)state < MAX_STATES)
+      ms_[(size_t)state] += ms;
+  }
+
+  void write_samples(Print& out) const override {
+    for (size_t i = 0; i < MAX_STATES; i++) {
+      if (!ms_[i])
+        continue;
+      out.print(name); out.print("{machine=\""); out.print(machine_); out.print("\",state=\""); out.print(i);
+      out.print("\"} "); out.print(ms_[i]); out.print('\n');
+    }
+  }
+};
+
+Gauge g_heap_free_metric{"mitsubino_heap_free_bytes", "Free heap right now", [] { return (int32_t)ESP.getFreeHeap(); }};
+#ifdef ESP32
+Gauge g_heap_min_free_metric{"mitsubino_heap_min_free_bytes", "Lowest free heap since boot", [] { return (int32_t)ESP.getMinFreeHeap(); }};
+#endif
@@ -13,6 +13,10 @@
 #include "MQTTClient.h"
 #include "HTTPConfigServer.h"
 #include "ESPNOWMsg.h"
+#include "MessageQueue.h"
+#include "Routes.h"
+
+static_assert(RoutingTable::MAX_CONFIG_LEN < sizeof(MQTTMessage::payload.data), "routes config has to fit in one queued MQTT message");
 
 #ifdef ESP32
 
@@ -46,10 +50,51 @@ MQTTStateMachine* g_mqtt = nullptr;
 HTTPConfigServer* g_server = nullptr;
 ESPNOWStateMachine* g_espnow = nullptr;
 
+RoutingTable g_routes{ &g_logger };
+
 Adafruit_SHT4x sht4{};
 SimpleTimer g_temp_timer{ 15000 };
 
-void handle_mqtt_message(char* topic, byte* payload, unsigned int length) {
+// Dual core mode: WiFi, MQTT, the HTTP server and OTA run in their own task pinned to
+// NETWORK_CORE, so a slow connect or HTTP request can't hold up ESP-NOW and device
+// control, which stay in loop() on the Arduino core. The two sides only exchange
+// MQTT messages, through the queues below.
+#ifndef MITSUBINO_DUAL_CORE
+#define MITSUBINO_DUAL_CORE 0
+#endif
+static constexpr BaseType_t NETWORK_CORE = 0;
+bool g_dual_core = false;
+
+Scheduler g_network_scheduler;
+LoopProfiler g_main_profiler{ "main" };
+LoopProfiler g_network_profiler{ "network" };
+MessageQueue<MQTTMessage, 4> g_mqtt_outbox;  // loop() -> network task
+MessageQueue<MQTTMessage, 4> g_mqtt_inbox;   // network task -> loop()
+Counter g_queue_full_metric{ "mitsubino_queue_full_total", "Messages dropped because a cross-core queue was full" };
+
+class OTATask : public ScheduledTask {
+  LoopSection section_{ "OTA" };
+
+protected:
+  void run() override {
+    ScopedTimer timer(section_);
+    ArduinoOTA.handle();
+    wake_in(POLL_MS);
+  }
+};
+OTATask* g_ota = nullptr;
+
+String get_topic_name(const char* suffix) {
+  return String("heatpumps/") + g_persistent_data.my_hostname + "/" + suffix;
+}
+
+void handle_control_message(const char* topic, const char* payload, unsigned int length) {
+  // retained, so the relay picks up its routes again on every reconnect
+  if (get_topic_name("routes") == topic) {
+    g_routes.parse(std::string_view(payload, length));
+    return;
+  }
+
   /*if (String(topic) != get_topic_name("control")) {
     g_logger.println("Received message at unrecognized topic: ", topic);
     return;
@@ -57,7 +102,7 @@ void handle_mqtt_message(char* topic, byte* payload, unsigned int length) {
 
   // this is probably fine
   String message;
-  message.concat((const char*)payload, length);
+  message.concat(payload, length);
   g_logger.println("Got MQTT message on topic ", topic, ": ", message);
   /*DynamicJsonDocument root(JSON_OBJECT_SIZE(6));
   DeserializationError error = deserializeJson(root, message.c_str());
@@ -86,6 +131,53 @@ void handle_mqtt_message(char* topic, byte* payload, unsigned int length) {
   g_logger.println("Updated heat pump");*/
 }
 
+// PubSubClient callback, runs wherever g_mqtt does
+void handle_mqtt_message(char* topic, byte* payload, unsigned int length) {
+  if (!g_dual_core) {
+    handle_control_message(topic, (const char*)payload, length);
+    return;
+  }
+  if (length >= sizeof(MQTTMessage::payload.data)) {
+    g_logger.println("Dropping ", length, " byte MQTT message on ", topic, ", too long to queue");
+    return;
+  }
+  MQTTMessage msg{ FixedString<64>(std::string_view(topic)), FixedString<512>(std::string_view((const char*)payload, length)) };
+  if (!g_mqtt_inbox.push(msg)) {
+    g_queue_full_metric.inc();
+  }
+  Scheduler::main().wake();
+}
+
+// publish from loop(), handing off to the network task in dual core mode
+bool mqtt_publish(const char* topic, const String& payload, bool retain) {
+  if (!g_mqtt) {
+    return false;
+  }
+  if (!g_dual_core) {
+    return g_mqtt->publish(topic, payload.c_str(), retain);
+  }
+  MQTTMessage msg{ FixedString<64>(std::string_view(topic)), FixedString<512>(payload), retain };
+  if (!g_mqtt_outbox.push(msg)) {
+    g_queue_full_metric.inc();
+    return false;
+  }
+  g_network_scheduler.wake();
+  return true;
+}
+
+void network_task(void*) {
+  g_network_scheduler.begin();
+  for (;;) {
+    g_network_scheduler.idle(Scheduler::FOREVER);
+    LoopProfiler::Iteration iteration(g_network_profiler);
+    g_network_scheduler.run_due();
+    MQTTMessage msg;
+    while (g_mqtt_outbox.pop(msg)) {
+      g_mqtt->publish(msg.topic.data.data(), msg.payload.data.data(), msg.retain);
+    }
+  }
+}
+
 #ifdef SDA1
 #define WIRE_TO_USE Wire1
 #define SDA_TO_USE SDA1
@@ -130,6 +222,7 @@ void setup() {
 
   g_logger.println("Starting setup");
   CRTPBase::logger_ = &g_logger;
+  Scheduler::main().begin();
 
   esp_reset_reason_t resetReason = esp_reset_reason();
   if (resetReason != ESP_RST_DEEPSLEEP) {
@@ -162,7 +255,7 @@ void setup() {
   // heatpumps talk over serial, not compatible with serial logging
   if (g_role != MitsubinoRole::Heatpump) {
     g_logger.set_serial(true);
-    Serial.print(g_logger.get());
+    g_logger.read_since(0, [](const char* s, size_t len) { Serial.write(s, len); });
   }
 
 
@@ -183,8 +276,23 @@ void setup() {
     MDNS.begin(g_persistent_data.my_hostname.c_str());
     g_server = new HTTPConfigServer(&g_logger, &g_persistent_data);
     ArduinoOTA.begin();
+    g_ota = new OTATask();
 
     g_mqtt = new MQTTStateMachine(&g_logger, g_persistent_data.my_hostname, g_persistent_data.mqtt_hostname, g_persistent_data.mqtt_username, g_persistent_data.mqtt_password, g_persistent_data.mqtt_port.toInt());
+    if (g_role == MitsubinoRole::Relay) {
+      g_routes.parse(g_persistent_data.routes.c_str());
+      g_mqtt->subscribe(get_topic_name("routes"));
+    }
+
+    if (MITSUBINO_DUAL_CORE) {
+      g_dual_core = true;
+      g_network_scheduler.adopt(*g_wifi);
+      g_network_scheduler.adopt(*g_server);
+      g_network_scheduler.adopt(*g_ota);
+      g_network_scheduler.adopt(*g_mqtt);
+      xTaskCreatePinnedToCore(network_task, "network", 8192, nullptr, 1, nullptr, NETWORK_CORE);
+      g_logger.println("Running network tasks on core ", NETWORK_CORE);
+    }
   }
   g_espnow = new ESPNOWStateMachine(&g_logger, g_persistent_data.my_hostname, !g_rtcdata.sleepEnabled, g_rtcdata.wifiChannel);
 
@@ -193,7 +301,8 @@ void setup() {
 }
 
 
-void read_sensor() {
+// JSON reading to send to the relay, or empty if the sensor couldn't be read
+String read_sensor() {
   g_logger.println("Free RAM: ", ESP.getFreeHeap());
   float uptime = millis();
   uptime /= (1000 * 60 * 60 * 24);
@@ -209,37 +318,29 @@ void read_sensor() {
   bool success = sht4.getEvent(&humidity, &temp);
   if (!success) {
     g_logger.println("Failed to read temp sensor");
-    return;
+    return String();
   }
 
-  {
-    DynamicJsonDocument msg(JSON_OBJECT_SIZE(2));
-    msg["temperature"] = temp.temperature;
-    msg["humidity"] = humidity.relative_humidity;
-
-    String s;
-    serializeJson(msg, s);
-
-    // don't retain these readings, so that the heat pump unit can fallback to
-    // internal thermostat if they stop sending for some reason
-    //if (!g_mqtt_client.publish(get_topic_name("reading").c_str(), s.c_str(), false)) {
-    //  g_logger.println("Failed to publish sensor readings to reading topic");
-    //}
-    //else {
-    //  g_logger.println("sent reading: ", s);
-    //}
-  }
-  if (g_persistent_data.my_hostname == "remote_temp_1") {
-    DynamicJsonDocument msg(JSON_OBJECT_SIZE(1));
-    msg["remoteTemp"] = temp.temperature;
-    String s;
-    serializeJson(msg, s);
-    g_logger.println("sending control setting: ", s);
-    //if (!g_mqtt_client.publish("heatpumps/hp_livingroom/control", s.c_str(), false))
-    //  g_logger.println("Failed to publish sensor readings to living room control topic");
-    //if (!g_mqtt_client.publish("heatpumps/hp_kitchen/control", s.c_str(), false))
-    //  g_logger.println("Failed to publish sensor readings to kitchen control topic");
-  }
+  DynamicJsonDocument msg(JSON_OBJECT_SIZE(2));
+  msg["temperature"] = temp.temperature;
+  msg["humidity"] = humidity.relative_humidity;
+
+  String s;
+  serializeJson(msg, s);
+  return s;
+}
+
+// relay side: ACK a sensor's reading, then publish it and fan it out along its
+// routes, so the sensor only has to send one frame per wake however many heat
+// pumps it drives
+void relay_reading(const ReceivedMessage& msg) {
+  MsgMQTTRelay ack{};
+  ack.sender = g_persistent_data.my_hostname;
+  ack.recipient = msg->sender;
+  ack.seqnum = msg->seqnum;
+  g_espnow->sendResponse(String((const char*)&ack, sizeof(ack)));
+
+  g_routes.forward(msg->sender, String(msg.body().c_str()), mqtt_publish, *g_espnow);
 }
 
 void disableInternalPower() {
@@ -256,7 +357,30 @@ void disableInternalPower() {
 
 SimpleTimer g_espnow_timer{ 5000 };
 
+void go_to_sleep() {
+  g_logger.println("Going to sleep");
+  g_rtcdata.numWakeups++;
+  g_rtcdata.wifiChannel = g_espnow->getChannel();
+  esp_sleep_enable_timer_wakeup(5000000);
+  disableInternalPower();
+  esp_deep_sleep_start();
+}
+
+// scheduled tasks time themselves, this covers everything else in loop()
+LoopSection g_app_section{ "App" };
+
+unsigned long max_idle_ms() {
+  // the timer only ticks while we can send; otherwise the ESP-NOW transitions
+  // wake us once we can again
+  if (g_role == MitsubinoRole::TemperatureSensor && !g_rtcdata.sleepEnabled && g_espnow->canSend()) {
+    return g_espnow_timer.remaining();
+  }
+  return Scheduler::FOREVER;
+}
+
 void loop() {
+  Scheduler::main().idle(max_idle_ms());
+  LoopProfiler::Iteration iteration(g_main_profiler);
   /*if (g_espnow_timer.tick()) {
     g_logger.println("Sending ESPNOW message");
     String msg = "Hello from ";
@@ -267,30 +391,26 @@ void loop() {
       g_logger.println("esp_now_send failed!");
     }
   }*/
-  if (g_wifi) {
-    g_wifi->loop();
+  Scheduler::main().run_due();
+  ScopedTimer timer(g_app_section);
+  MQTTMessage mqtt_msg;
+  while (g_mqtt_inbox.pop(mqtt_msg)) {
+    handle_control_message(mqtt_msg.topic.data.data(), mqtt_msg.payload.data.data(), strlen(mqtt_msg.payload.data.data()));
   }
-  if (g_server) {
-    g_server->loop();
-    ArduinoOTA.handle();
-  }
-  if (g_mqtt) {
-    g_mqtt->loop();
-  }
-  g_espnow->loop();
   if (g_espnow->hasReceived()) {
     auto msg = g_espnow->getReceived();
     switch (g_role) {
       case MitsubinoRole::Relay:
         if (msg.type == ReceivedMessage::Type::Unicast) {
-          g_logger.println("Got unicast message from ", msg->sender, ": ", msg.body().c_str(), ", sending response");
-          MsgMQTTRelay response{};
-          response.sender = g_persistent_data.my_hostname;
-          response.recipient = msg->sender;
-          response.seqnum = msg->seqnum;
-          response.body = String("responding to hellow world");
-          const char* mstart = (const char*)&response;
-          g_espnow->sendResponse(String(mstart, sizeof(response)));
+          g_logger.println("Got reading from ", msg->sender, ": ", msg.body().c_str());
+          relay_reading(msg);
+        }
+        break;
+      case MitsubinoRole::Heatpump:
+        // readings routed to us by the relay
+        if (msg.type == ReceivedMessage::Type::Unicast) {
+          String body(msg.body().c_str());
+          handle_control_message("espnow", body.c_str(), body.length());
         }
         break;
       case MitsubinoRole::TemperatureSensor:
@@ -298,12 +418,7 @@ void loop() {
           g_logger.println("Got response in ", g_espnow_timer.value(), "ms from ", msg->sender, ": ", msg.body().c_str());
         }
         if (g_rtcdata.sleepEnabled) {
-          g_logger.println("Going to sleep");
-          g_rtcdata.numWakeups++;
-          g_rtcdata.wifiChannel = g_espnow->getChannel();
-          esp_sleep_enable_timer_wakeup(5000000);
-          disableInternalPower();
-          esp_deep_sleep_start();
+          go_to_sleep();
         }
         break;
     }
@@ -319,10 +434,17 @@ void loop() {
       msg.sender = g_persistent_data.my_hostname;
       msg.recipient = "hp_relay";
       msg.seqnum = 11;
-      msg.body = String("greetings from temp sensor at ") + String(millis()) + String(" after attempts: ") + String(g_espnow->numAttempts());
-      const char* mstart = (const char*)&msg;
-      g_espnow->sendMessage(String(mstart, sizeof(msg)));
-      g_logger.println("Sent to relay");
+      String reading = read_sensor();
+      if (!reading.isEmpty()) {
+        msg.body = reading;
+        const char* mstart = (const char*)&msg;
+        g_espnow->sendMessage(String(mstart, sizeof(msg)));
+        g_logger.println("Sent reading to relay: ", reading);
+      }
+      else if (g_rtcdata.sleepEnabled) {
+        // nothing to send, try again next wake rather than rereading every loop
+        go_to_sleep();
+      }
     }
   }
 }
@@ -11,7 +11,8 @@
   FUN(mqtt_port) \
   FUN(mqtt_username) \
   FUN(mqtt_password) \
-  FUN(role)
+  FUN(role) \
+  FUN(routes)
 
 struct PersistentData {
 #define MEMBER_HELPER(X) String X;
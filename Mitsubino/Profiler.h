@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+
+#include "Metrics.h"
+
+/// Microsecond timing of each subsystem's share of loop(). A section costs two
+/// micros() calls and a short bucket search per run, so it stays on in production.
+/// Sections show up as histograms on /metrics, and /profile dumps a summary along
+/// with the slowest iteration of each task's loop and which section was to blame.
+
+static constexpr std::array<uint32_t, 11> LOOP_US_BUCKETS{50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 500000};
+
+class LoopSection {
+  static LoopSection* head_;
+  LoopSection* next_;
+  Histogram<LOOP_US_BUCKETS.size()> hist_;
+  uint32_t max_us_{0};
+
+public:
+  const char* const section;
+
+  LoopSection(const char* section)
+    : next_(head_), hist_("mitsubino_loop_section_us", "Microseconds per call of each loop() section", LOOP_US_BUCKETS, "section", section), section(section) {
+    head_ = this;
+  }
+
+  LoopSection(const LoopSection&) = delete;
+
+  inline void record(uint32_t us);
+
+  static void reset_max() {
+    for (LoopSection* s = head_; s; s = s->next_)
+      s->max_us_ = 0;
+  }
+
+  static void dump(Print& out) {
+    for (const LoopSection* s = head_; s; s = s->next_) {
+      uint32_t calls = s->hist_.count();
+      out.print(s->section); out.print(": calls "); out.print(calls);
+      out.print(", mean "); out.print(calls ? (uint32_t)(s->hist_.sum() / calls) : 0);
+      out.print("us, max "); out.print(s->max_us_); out.print("us\n");
+    }
+  }
+};
+LoopSection* LoopSection::head_ = nullptr;
+
+// Tracks whole iterations of one task's loop, eg loop() itself or the network task
+// in dual core mode. Create one Iteration at the top of each pass.
+class LoopProfiler {
+  static LoopProfiler* head_;
+  // the profiler whose iteration is running in this task, tasks may share a core
+  static thread_local LoopProfiler* current_;
+  LoopProfiler* next_;
+  Histogram<LOOP_US_BUCKETS.size()> iteration_metric_;
+  uint32_t iteration_start_{0};
+  const LoopSection* longest_section_{nullptr};
+  uint32_t longest_section_us_{0};
+  uint32_t worst_us_{0};
+  const LoopSection* worst_culprit_{nullptr};
+  uint32_t worst_culprit_us_{0};
+
+public:
+  const char* const task;
+
+  LoopProfiler(const char* task)
+    : next_(head_), iteration_metric_("mitsubino_loop_iteration_us", "Microseconds per loop iteration of each task", LOOP_US_BUCKETS, "task", task), task(task) {
+    head_ = this;
+  }
+
+  LoopProfiler(const LoopProfiler&) = delete;
+
+  class Iteration {
+    LoopProfiler& profiler_;
+
+  public:
+    Iteration(LoopProfiler& profiler) : profiler_(profiler) {
+      profiler_.iteration_start_ = micros();
+      profiler_.longest_section_ = nullptr;
+      profiler_.longest_section_us_ = 0;
+      current_ = &profiler_;
+    }
+    ~Iteration() {
+      LoopProfiler& p = profiler_;
+      current_ = nullptr;
+      uint32_t us = micros() - p.iteration_start_;
+      p.iteration_metric_.observe(us);
+      if (us > p.worst_us_) {
+        p.worst_us_ = us;
+        p.worst_culprit_ = p.longest_section_;
+        p.worst_culprit_us_ = p.longest_section_us_;
+      }
+    }
+  };
+
+  static void note(const LoopSection* section, uint32_t us) {
+    LoopProfiler* p = current_;
+    if (p && us > p->longest_section_us_) {
+      p->longest_section_ = section;
+      p->longest_section_us_ = us;
+    }
+  }
+
+  // summary of every section plus the worst iteration per task; reset starts a fresh worst-case window
+  static void dump(Print& out, bool reset) {
+    for (LoopProfiler* p = head_; p; p = p->next_) {
+      out.print("worst "); out.print(p->task); out.print(" iteration: "); out.print(p->worst_us_); out.print("us, culprit ");
+      out.print(p->worst_culprit_ ? p->worst_culprit_->section : "none");
+      out.print(" ("); out.print(p->worst_culprit_us_); out.print("us)\n");
+      if (reset) {
+        p->worst_us_ = 0;
+        p->worst_culprit_ = nullptr;
+        p->worst_culprit_us_ = 0;
+      }
+    }
+    LoopSection::dump(out);
+    if (reset)
+      LoopSection::reset_max();
+  }
+};
+LoopProfiler* LoopProfiler::head_ = nullptr;
+thread_local LoopProfiler* LoopProfiler::current_ = nullptr;
+
+void LoopSection::record(uint32_t us) {
+  hist_.observe(us);
+  max_us_ = std::max(max_us_, us);
+  LoopProfiler::note(this, us);
+}
+
+// times the enclosing scope into a LoopSection
+class ScopedTimer {
+  LoopSection& section_;
+  const uint32_t start_;
+
+public:
+  ScopedTimer(LoopSection& section) : section_(section), start_(micros()) {}
+  ~ScopedTimer() {
+    section_.record(micros() - start_);
+  }
+};
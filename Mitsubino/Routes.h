@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+#include "Logger.h"
+#include "ESPNOWMsg.h"
+
+/// Relay-side routing of sensor readings. Maps a sensor's hostname to everywhere its
+/// readings should go, so a sensor sends a single frame per wake and the relay fans
+/// it out locally. Configured as "sensor=dest,dest;sensor=dest" (newlines also
+/// separate routes). A destination containing '/' is an MQTT topic, anything else
+/// is the hostname of an ESP-NOW node. Configs longer than MAX_CONFIG_LEN are
+/// rejected, so one always fits in a single queued MQTT message.
+class RoutingTable {
+public:
+  static constexpr size_t MAX_ROUTES = 8;
+  static constexpr size_t MAX_DESTINATIONS = 4;
+  static constexpr size_t MAX_CONFIG_LEN = 511;
+
+  struct Destination {
+    FixedString<64> name;
+    bool is_topic;
+  };
+
+  struct Route {
+    FixedString<16> sensor;
+    std::array<Destination, MAX_DESTINATIONS> destinations;
+    size_t count;
+  };
+
+private:
+  std::array<Route, MAX_ROUTES> routes_{};
+  size_t count_{0};
+  uint32_t seqnum_{0};
+  Logger* logger_;
+
+  static std::string_view trim(std::string_view s) {
+    while (!s.empty() && isspace((unsigned char)s.front()))
+      s.remove_prefix(1);
+    while (!s.empty() && isspace((unsigned char)s.back()))
+      s.remove_suffix(1);
+    return s;
+  }
+
+  // splits off everything up to the first of seps, advancing s past it
+  static std::string_view next_token(std::string_view& s, std::string_view seps) {
+    size_t end = s.find_first_of(seps);
+    std::string_view token = s.substr(0, end);
+    s.remove_prefix(end == std::string_view::npos ? s.size() : end + 1);
+    return trim(token);
+  }
+
+  void parse_route(std::string_view entry) {
+    size_t eq = entry.find('=');
+    std::string_view sensor = trim(entry.substr(0, eq));
+    if (eq == std::string_view::npos || sensor.empty() || sensor.size() > 15) {
+      logger_->println("Ignoring malformed route: ", String(entry.data(), entry.size()));
+      return;
+    }
+    if (count_ == MAX_ROUTES) {
+      logger_->println("Too many routes, ignoring route for ", String(sensor.data(), sensor.size()));
+      return;
+    }
+    Route& route = routes_[count_];
+    route = Route{FixedString<16>(sensor), {}, 0};
+    std::string_view dests = entry.substr(eq + 1);
+    while (!dests.empty()) {
+      std::string_view dest = next_token(dests, ",");
+      if (dest.empty())
+        continue;
+      bool is_topic = dest.find('/') != std::string_view::npos;
+      if (route.count == MAX_DESTINATIONS || dest.size() > (is_topic ? 63 : 15)) {
+        logger_->println("Ignoring destination ", String(dest.data(), dest.size()), " for ", String(sensor.data(), sensor.size()));
+        continue;
+      }
+      route.destinations[route.count++] = Destination{FixedString<64>(dest), is_topic};
+    }
+    count_++;
+  }
+
+public:
+  RoutingTable(Logger* logger) : logger_(logger) {}
+
+  // replaces the whole table, or leaves it alone if the config is too long
+  void parse(std::string_view config) {
+    if (config.size() > MAX_CONFIG_LEN) {
+      logger_->println("Routes config is ", config.size(), " bytes, max is ", MAX_CONFIG_LEN, ", keeping current routes");
+      return;
+    }
+    count_ = 0;
+    while (!config.empty()) {
+      std::string_view entry = next_token(config, ";\n");
+      if (!entry.empty())
+        parse_route(entry);
+    }
+    logger_->println("Loaded ", count_, " sensor routes");
+  }
+
+  const Route* find(const FixedString<16>& sensor) const {
+    for (size_t i = 0; i < count_; i++) {
+      if (routes_[i].sensor == sensor)
+        return &routes_[i];
+    }
+    return nullptr;
+  }
+
+  // {"remoteTemp":t} for the heat pumps from a sensor's {"temperature":t,...} reading,
+  // empty if there's no temperature in it. The number is copied over as it was sent.
+  static String control_message(const String& reading) {
+    static constexpr std::string_view key = "\"temperature\"";
+    std::string_view s(reading.c_str(), reading.length());
+    size_t at = s.find(key);
+    if (at == std::string_view::npos)
+      return String();
+    s = trim(s.substr(at + key.size()));
+    if (s.empty() || s.front() != ':')
+      return String();
+    s = trim(s.substr(1));
+    std::string_view value = s.substr(0, s.find_first_not_of("0123456789+-.eE"));
+    if (value.empty())
+      return String();
+    return String("{\"remoteTemp\":") + String(value.data(), value.size()) + "}";
+  }
+
+  // Publishes a sensor's reading to heatpumps/<sensor>/reading and passes it on to
+  // everything on the sensor's route as a control message: topics through
+  // publish(topic, payload, retain), hostnames as ESP-NOW frames. Those aren't acked,
+  // the next reading supersedes a lost one. Returns whether the reading was published.
+  template <typename Publish>
+  bool forward(const FixedString<16>& sensor, const String& reading, Publish&& publish, ESPNOWStateMachine& espnow) {
+    String name(sensor.data.data());
+    // don't retain these readings, so that the heat pump unit can fallback to
+    // internal thermostat if they stop sending for some reason
+    String topic = String("heatpumps/") + name + "/reading";
+    bool published = publish(topic.c_str(), reading, false);
+    if (!published)
+      logger_->println("Failed to publish reading from ", name);
+
+    const Route* route = find(sensor);
+    if (!route)
+      return published;
+    String control = control_message(reading);
+    if (control.isEmpty()) {
+      logger_->println("Can't route reading without a temperature from ", name, ": ", reading);
+      return published;
+    }
+    for (size_t i = 0; i < route->count; i++) {
+      const Destination& dest = route->destinations[i];
+      if (dest.is_topic) {
+        if (!publish(dest.name.data.data(), control, false))
+          logger_->println("Failed to publish reading from ", name, " to ", dest.name);
+        continue;
+      }
+      MsgMQTTRelay msg{};
+      msg.sender = espnow.hostname();
+      msg.recipient = String(dest.name.data.data());
+      msg.seqnum = ++seqnum_;
+      msg.body = control;
+      espnow.sendResponse(String((const char*)&msg, sizeof(msg)));
+    }
+    return published;
+  }
+};
@@ -6,7 +6,12 @@
 #include <WiFi.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+
 #include "Logger.h"
+#include "Metrics.h"
+#include "Profiler.h"
 
 struct SimpleTimer {
   const int interval;
@@ -30,15 +35,175 @@ struct SimpleTimer {
   unsigned long int value() const {
     return millis() - last_tick;
   }
+  // ms until the next tick is due, for the scheduler
+  unsigned long remaining() const {
+    unsigned long v = value();
+    unsigned long i = (unsigned long)interval;
+    return v >= i ? 0 : i - v;
+  }
+};
+
+class Scheduler;
+
+/// Anything a Scheduler runs. During each run a task can ask to be woken after
+/// some ms (the earliest request wins) or to wait for an event; a task that asks
+/// for neither is polled again on the next pass, same as before the scheduler.
+/// notify() wakes a task early and is safe to call from other tasks and the
+/// ESP-NOW/WiFi callbacks. Tasks start out on Scheduler::main().
+class ScheduledTask {
+  ScheduledTask* next_{nullptr};
+  Scheduler* scheduler_{nullptr};
+  std::atomic<bool> notified_{true};
+  unsigned long last_run_{0};
+  unsigned long wake_in_{0};
+  bool waiting_{false};
+
+  friend class Scheduler;
+
+protected:
+  static constexpr unsigned long FOREVER = ~0ul;
+  // for tasks wrapping libraries that can't tell us when they have work (WebServer,
+  // PubSubClient, ArduinoOTA), so we poll them. Short enough not to add noticeable
+  // latency, long enough that the CPU still sleeps most of the time.
+  static constexpr unsigned long POLL_MS = 10;
+
+  inline ScheduledTask();
+  inline virtual ~ScheduledTask();
+
+  virtual void run() = 0;
+
+  // ms from the start of this run until we want to run again
+  void wake_in(unsigned long ms) {
+    wake_in_ = waiting_ ? std::min(wake_in_, ms) : ms;
+    waiting_ = true;
+  }
+
+  // nothing to do until someone calls notify()
+  void wait_for_event() {
+    wake_in(FOREVER);
+  }
+
+public:
+  inline void notify();
 };
 
+/// Runs only the tasks that are due, in the order they were added, and blocks the
+/// FreeRTOS task that owns it in between. Blocking on a task notification lets the
+/// idle task halt the CPU (and enter automatic light sleep on builds with power
+/// management enabled) until the next deadline or until someone calls notify().
+/// There is one Scheduler per FreeRTOS task; main() belongs to the Arduino loop().
+class Scheduler {
+  static Scheduler main_;
+  ScheduledTask* head_{nullptr};
+  TaskHandle_t task_{nullptr};
+
+  unsigned long due_in(const ScheduledTask* t, unsigned long now) const {
+    if (t->notified_ || t->wake_in_ == 0)
+      return 0;
+    if (t->wake_in_ == ScheduledTask::FOREVER)
+      return ScheduledTask::FOREVER;
+    unsigned long elapsed = now - t->last_run_;
+    return elapsed >= t->wake_in_ ? 0 : t->wake_in_ - elapsed;
+  }
+
+public:
+  static constexpr unsigned long FOREVER = ScheduledTask::FOREVER;
+
+  static Scheduler& main() {
+    return main_;
+  }
+
+  void add(ScheduledTask* task) {
+    ScheduledTask** t = &head_;
+    while (*t)
+      t = &(*t)->next_;
+    *t = task;
+    task->scheduler_ = this;
+  }
+
+  void remove(ScheduledTask* task) {
+    for (ScheduledTask** t = &head_; *t; t = &(*t)->next_) {
+      if (*t == task) {
+        *t = task->next_;
+        break;
+      }
+    }
+    task->next_ = nullptr;
+    task->scheduler_ = nullptr;
+  }
+
+  // takes a task over from whichever scheduler has it, before either one is running it
+  void adopt(ScheduledTask& task) {
+    if (task.scheduler_)
+      task.scheduler_->remove(&task);
+    add(&task);
+  }
+
+  // call on the task that will run this scheduler, before the first idle()
+  void begin() {
+    task_ = xTaskGetCurrentTaskHandle();
+  }
+
+  void run_due() {
+    for (ScheduledTask* t = head_; t; t = t->next_) {
+      unsigned long now = millis();
+      if (due_in(t, now))
+        continue;
+      t->last_run_ = now;
+      t->notified_ = false;
+      t->waiting_ = false;
+      t->run();
+      if (!t->waiting_)
+        t->wake_in_ = 0;
+    }
+  }
+
+  // ms until the earliest task deadline, capped at max_ms
+  unsigned long ms_until_due(unsigned long max_ms) const {
+    unsigned long now = millis();
+    unsigned long wait = max_ms;
+    for (ScheduledTask* t = head_; t && wait; t = t->next_)
+      wait = std::min(wait, due_in(t, now));
+    return wait;
+  }
+
+  // blocks until the earliest task deadline, a notify(), or max_ms, whichever comes first
+  void idle(unsigned long max_ms) {
+    unsigned long wait = ms_until_due(max_ms);
+    if (!wait)
+      return;
+    ulTaskNotifyTake(pdTRUE, wait == FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait));
+  }
+
+  void wake() {
+    if (task_)
+      xTaskNotifyGive(task_);
+  }
+};
+Scheduler Scheduler::main_;
+
+ScheduledTask::ScheduledTask() {
+  Scheduler::main().add(this);
+}
+
+ScheduledTask::~ScheduledTask() {
+  if (scheduler_)
+    scheduler_->remove(this);
+}
+
+void ScheduledTask::notify() {
+  notified_ = true;
+  if (scheduler_)
+    scheduler_->wake();
+}
+
 struct CRTPBase {
   static Logger* logger_;
 };
 Logger* CRTPBase::logger_ = nullptr;
 
 template <typename T, typename STATES>
-class CRTPStateMachine {
+class CRTPStateMachine : public ScheduledTask {
 public:
   using state_t = STATES;
   static Logger* logger_;
@@ -48,6 +213,10 @@ private:
   unsigned long last_tick_;
   uint64_t time_in_state_;
 
+  // shared by every instance of T, exported on /metrics
+  static StateTimeMetric state_time_metric_;
+  static LoopSection loop_section_;
+
   T* derived() {
     return static_cast<T*>(this);
   }
@@ -67,13 +236,28 @@ public:
     return time_in_state_;
   }
 
+  // true once we have been in this state for ms, otherwise asks the scheduler
+  // to run us again when that will be the case
+  bool in_state_for(unsigned long ms) {
+    if (time_in_state_ >= ms)
+      return true;
+    wake_in(ms - time_in_state_);
+    return false;
+  }
+
   void transition(state_t new_state) {
     if (new_state == state_)
       return;
     auto old_state = state_;
+    // account for the rest of the old state's stay, it may be left from a callback
+    // without another loop() in between
+    unsigned long curtime = millis();
+    state_time_metric_.add(istate(), curtime - last_tick_);
     state_ = new_state;
     time_in_state_ = 0;
-    last_tick_ = millis();
+    last_tick_ = curtime;
+    // the new state gets its first look on the next pass
+    notify();
     if (CRTPBase::logger_) {
       CRTPBase::logger_->println(T::name, " transitioning from ", (int)old_state, " to ", (int)new_state);
     }
@@ -82,7 +266,19 @@ public:
   void loop() {
     unsigned long curtime = millis();
     time_in_state_ += (curtime - last_tick_);
+    state_time_metric_.add(istate(), curtime - last_tick_);
     last_tick_ = curtime;
+    ScopedTimer timer(loop_section_);
     derived()->loopImpl();
   }
+
+protected:
+  void run() override {
+    loop();
+  }
 };
+
+template <typename T, typename STATES>
+StateTimeMetric CRTPStateMachine<T, STATES>::state_time_metric_{T::name};
+template <typename T, typename STATES>
+LoopSection CRTPStateMachine<T, STATES>::loop_section_{T::name};
@@ -18,6 +18,10 @@ enum class WifiStates : int {
 
 class WifiClientStateMachine : public CRTPStateMachine<WifiClientStateMachine, WifiStates> {
   Logger* logger_;
+
+  // WiFi events wake us, this is only a backstop
+  static constexpr unsigned long BACKSTOP_MS = 1000;
+
 public:
   using CRTPStateMachine::state_t;
 
@@ -32,6 +36,7 @@ public:
     esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G);
     WiFi.hostname(hostname);
     WiFi.begin(ssid, password);
+    WiFi.onEvent([this](arduino_event_id_t, arduino_event_info_t) { notify(); });
   }
 
   bool connected() {
@@ -44,20 +49,26 @@ public:
         if (WiFi.status() != WL_CONNECTED) {
           transition(state_t::DISCONNECTED);
         }
+        else {
+          wake_in(BACKSTOP_MS);
+        }
         return;
       case state_t::CONNECTING:
-        if (time_in_state() > 100 && WiFi.status() == WL_CONNECTED) {
+        if (in_state_for(100) && WiFi.status() == WL_CONNECTED) {
           transition(state_t::CONNECTED);
           logger_->println("Connected to ", WiFi.SSID());
           logger_->println("IP address: ", WiFi.localIP().toString());
         }
-        else if (time_in_state() > 120*1000) {
+        else if (in_state_for(120*1000)) {
           ESP.restart(); // RIP
         }
+        else {
+          wake_in(BACKSTOP_MS);
+        }
         return;
       case state_t::DISCONNECTED:
         // if we just disconnected, give it some time first
-        if (time_in_state() > 100) {
+        if (in_state_for(100)) {
           WiFi.begin();
           transition(state_t::CONNECTING);
         }
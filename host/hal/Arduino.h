@@ -0,0 +1,121 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core the Mitsubino headers use.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "esp_mac.h"
+#include "sim_context.h"
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+
+typedef uint8_t byte;
+
+class String {
+  std::string s_;
+
+public:
+  String() = default;
+  String(const char* s) : s_(s ? s : "") {}
+  String(const char* s, size_t len) : s_(s, len) {}
+  String(const std::string& s) : s_(s) {}
+  String(char c) : s_(1, c) {}
+  String(bool b) : s_(b ? "1" : "0") {}
+  template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+  String(T v) : s_(std::to_string(v)) {}
+  String(double v, unsigned int decimals = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+    s_ = buf;
+  }
+  String(float v, unsigned int decimals = 2) : String((double)v, decimals) {}
+
+  size_t length() const { return s_.size(); }
+  bool isEmpty() const { return s_.empty(); }
+  const char* c_str() const { return s_.c_str(); }
+  char* begin() { return s_.data(); }
+  const char* begin() const { return s_.data(); }
+  char* end() { return s_.data() + s_.size(); }
+  const char* end() const { return s_.data() + s_.size(); }
+  void clear() { s_.clear(); }
+  void reserve(size_t n) { s_.reserve(n); }
+  bool concat(const String& s) { s_ += s.s_; return true; }
+  bool concat(const char* s, size_t len) { s_.append(s, len); return true; }
+  void remove(size_t index, size_t count) { s_.erase(index, count); }
+  String substring(size_t from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+  String substring(size_t from, size_t to) const { return from < s_.size() ? String(s_.substr(from, to - from)) : String(); }
+  long toInt() const { return strtol(s_.c_str(), nullptr, 10); }
+
+  String& operator+=(const String& s) { s_ += s.s_; return *this; }
+  bool operator==(const String& s) const { return s_ == s.s_; }
+  bool operator!=(const String& s) const { return s_ != s.s_; }
+  bool operator==(const char* s) const { return s_ == s; }
+  friend String operator+(String a, const String& b) { a += b; return a; }
+  friend String operator+(const char* a, const String& b) { return String(a) + b; }
+};
+
+class Print {
+public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t len) {
+    for (size_t i = 0; i < len; i++)
+      write(buf[i]);
+    return len;
+  }
+  size_t write(const char* buf, size_t len) { return write((const uint8_t*)buf, len); }
+  virtual void flush() {}
+
+  size_t print(const char* s) { return write(s, strlen(s)); }
+  size_t print(const String& s) { return write(s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+  size_t print(T v) { return print(String(v)); }
+  template <typename T>
+  size_t println(const T& t) { return print(t) + print("\r\n"); }
+};
+
+class HardwareSerial : public Print {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+  size_t write(const uint8_t* buf, size_t len) override { return fwrite(buf, 1, len, stdout); }
+};
+HardwareSerial Serial;
+
+inline unsigned long millis() { return sim::now_us / 1000; }
+inline unsigned long micros() { return sim::now_us; }
+inline void delay(unsigned long) {}
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 180000; }
+  [[noreturn]] void restart() {
+    fprintf(stderr, "%s: ESP.restart() called\n", sim::current ? sim::current->name.c_str() : "?");
+    exit(1);
+  }
+};
+EspClass ESP;
+
+// FreeRTOS, just enough for the Scheduler; the harness drives time itself so nothing blocks
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+#define pdTRUE 1
+#define portMAX_DELAY 0xffffffffu
+#define pdMS_TO_TICKS(ms) (ms)
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+inline uint32_t ulTaskNotifyTake(BaseType_t, uint32_t) { return 0; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
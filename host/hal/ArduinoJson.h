@@ -0,0 +1,3 @@
+#pragma once
+
+// The host build doesn't use ArduinoJson, this only satisfies the include in MQTTClient.h.
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "Arduino.h"
+
+// in-memory stand-in, shared by every simulated node
+class File {
+  std::string* contents_{nullptr};
+
+public:
+  File() = default;
+  File(std::string* contents) : contents_(contents) {}
+  explicit operator bool() const { return contents_ != nullptr; }
+  String readString() { return contents_ ? String(*contents_) : String(); }
+  size_t print(const String& s) {
+    contents_->append(s.c_str(), s.length());
+    return s.length();
+  }
+};
+
+class LittleFSFS {
+  std::map<std::string, std::string> files_;
+
+public:
+  bool begin(bool = false) { return true; }
+  void end() {}
+  File open(const String& path, const char* mode) {
+    std::string p(path.c_str());
+    if (mode[0] == 'w')
+      return File(&(files_[p] = std::string()));
+    auto it = files_.find(p);
+    return it == files_.end() ? File() : File(&it->second);
+  }
+};
+LittleFSFS LittleFS;
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "WiFi.h"
+
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+
+class PubSubClient;
+
+namespace sim {
+
+/// Local stand-in for the MQTT broker. Publishes are delivered to subscribed clients
+/// on their next loop(), and every publish is offered to on_publish for the harness.
+struct Broker {
+  bool up{true};
+  std::multimap<std::string, PubSubClient*> subscriptions;
+  std::function<void(const std::string& client, const std::string& topic, const std::string& payload)> on_publish;
+};
+inline Broker broker;
+
+}  // namespace sim
+
+class PubSubClient {
+public:
+  typedef void (*callback_t)(char*, uint8_t*, unsigned int);
+
+private:
+  sim::NodeContext* node_{nullptr};
+  std::string id_;
+  bool connected_{false};
+  callback_t callback_{nullptr};
+  std::deque<std::pair<std::string, std::string>> inbox_;
+
+public:
+  PubSubClient(WiFiClient&) {}
+
+  void setServer(const char*, uint16_t) {}
+  bool setBufferSize(uint16_t) { return true; }
+  void setCallback(callback_t cb) { callback_ = cb; }
+
+  bool connect(const char* id, const char*, const char*) {
+    node_ = sim::current;
+    id_ = id;
+    connected_ = sim::broker.up && sim::wifi_connected(*node_);
+    return connected_;
+  }
+
+  bool connected() {
+    if (connected_ && !(sim::broker.up && sim::wifi_connected(*node_)))
+      disconnect();
+    return connected_;
+  }
+
+  void disconnect() {
+    connected_ = false;
+    for (auto it = sim::broker.subscriptions.begin(); it != sim::broker.subscriptions.end();)
+      it = it->second == this ? sim::broker.subscriptions.erase(it) : std::next(it);
+  }
+
+  int state() const { return connected_ ? MQTT_CONNECTED : MQTT_CONNECT_FAILED; }
+
+  bool subscribe(const char* topic) {
+    if (!connected_)
+      return false;
+    sim::broker.subscriptions.emplace(topic, this);
+    return true;
+  }
+
+  bool publish(const char* topic, const char* payload, bool = false) {
+    if (!connected())
+      return false;
+    if (sim::broker.on_publish)
+      sim::broker.on_publish(id_, topic, payload);
+    auto range = sim::broker.subscriptions.equal_range(topic);
+    for (auto it = range.first; it != range.second; ++it)
+      it->second->inbox_.emplace_back(topic, payload);
+    return true;
+  }
+
+  bool loop() {
+    if (!connected())
+      return false;
+    while (!inbox_.empty()) {
+      auto msg = std::move(inbox_.front());
+      inbox_.pop_front();
+      if (callback_)
+        callback_(msg.first.data(), (uint8_t*)msg.second.data(), msg.second.size());
+    }
+    return true;
+  }
+};
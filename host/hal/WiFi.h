@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_DISCONNECTED = 6,
+} wl_status_t;
+
+typedef enum { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+
+typedef enum {
+  ARDUINO_EVENT_WIFI_STA_START = 2,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED = 4,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP = 7,
+} arduino_event_id_t;
+
+struct arduino_event_info_t {};
+
+class IPAddress {
+public:
+  String toString() const { return "10.0.0.2"; }
+};
+
+class WiFiClient {};
+
+class WiFiSTAClass {
+public:
+  bool started() const { return sim::current->sta_started; }
+};
+
+// every call acts on sim::current; connecting finishes connect_ms after begin()
+class WiFiClass {
+public:
+  WiFiSTAClass STA;
+
+  void persistent(bool) {}
+  void setAutoReconnect(bool) {}
+  void setSleep(bool) {}
+  void hostname(const String&) {}
+
+  void mode(wifi_mode_t m) {
+    sim::current->sta_started = (m == WIFI_STA || m == WIFI_AP_STA);
+  }
+
+  void begin(const String& = String(), const String& = String()) {
+    sim::NodeContext* node = sim::current;
+    node->wifi_begun = true;
+    node->wifi_begin_us = sim::now_us;
+    if (!node->has_ap)
+      return;
+    node->channel = node->ap_channel;
+    if (sim::schedule) {
+      sim::schedule(sim::now_us + node->connect_ms * 1000, *node, [node] {
+        for (auto& cb : node->wifi_event_cbs)
+          cb(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+      });
+    }
+  }
+
+  wl_status_t status() const {
+    return sim::wifi_connected(*sim::current) ? WL_CONNECTED : WL_DISCONNECTED;
+  }
+
+  void onEvent(std::function<void(arduino_event_id_t, arduino_event_info_t)> cb) {
+    sim::current->wifi_event_cbs.push_back([cb](int id) { cb((arduino_event_id_t)id, {}); });
+  }
+
+  String SSID() const { return "simulated"; }
+  IPAddress localIP() const { return {}; }
+};
+WiFiClass WiFi;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "esp_wifi.h"
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_DATA_LEN 250
+#define ESP_NOW_MAX_DATA_LEN_V2 1470
+#define ESP_ERR_ESPNOW_ARG 0x3066
+
+enum esp_now_send_status_t : int {
+  ESP_NOW_SEND_SUCCESS = 0,
+  ESP_NOW_SEND_FAIL,
+};
+
+struct esp_now_send_info_t {
+  uint8_t des_addr[ESP_NOW_ETH_ALEN];
+};
+
+struct esp_now_recv_info_t {
+  uint8_t src_addr[ESP_NOW_ETH_ALEN];
+  uint8_t des_addr[ESP_NOW_ETH_ALEN];
+};
+
+struct esp_now_peer_info_t {
+  uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+  uint8_t channel;
+  bool encrypt;
+};
+
+inline esp_err_t esp_now_init() { return ESP_OK; }
+inline esp_err_t esp_now_add_peer(const esp_now_peer_info_t*) { return ESP_OK; }
+
+inline esp_err_t esp_now_get_version(uint32_t* version) {
+  *version = 2;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) {
+  sim::current->send_cb = cb;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+  sim::current->recv_cb = cb;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_now_send(const uint8_t*, const uint8_t* data, size_t len) {
+  if (len > ESP_NOW_MAX_DATA_LEN_V2)
+    return ESP_ERR_ESPNOW_ARG;
+  if (sim::transmit)
+    sim::transmit(*sim::current, data, len);
+  return ESP_OK;
+}
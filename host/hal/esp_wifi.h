@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Arduino.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef enum { WIFI_IF_STA, WIFI_IF_AP } wifi_interface_t;
+typedef enum { WIFI_SECOND_CHAN_NONE, WIFI_SECOND_CHAN_ABOVE, WIFI_SECOND_CHAN_BELOW } wifi_second_chan_t;
+
+#define WIFI_PROTOCOL_11B 1
+#define WIFI_PROTOCOL_11G 2
+#define WIFI_PROTOCOL_11N 4
+
+inline esp_err_t esp_wifi_set_protocol(wifi_interface_t, uint8_t) { return ESP_OK; }
+inline esp_err_t esp_wifi_set_promiscuous(bool) { return ESP_OK; }
+
+inline esp_err_t esp_wifi_get_mac(wifi_interface_t, uint8_t mac[6]) {
+  memcpy(mac, sim::current->mac, 6);
+  return ESP_OK;
+}
+
+// a station connected to an access point is stuck on the AP's channel
+inline esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t) {
+  if (sim::wifi_connected(*sim::current))
+    return ESP_FAIL;
+  if (sim::current->channel != primary)
+    sim::current->channel_changes++;
+  sim::current->channel = primary;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_wifi_get_channel(uint8_t* primary, wifi_second_chan_t* second) {
+  *primary = sim::current->channel;
+  *second = WIFI_SECOND_CHAN_NONE;
+  return ESP_OK;
+}
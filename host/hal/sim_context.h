@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// Shared state behind the host stand-in HAL. One process simulates several nodes,
+/// so everything the firmware treats as "the device" lives in a NodeContext, and the
+/// harness points sim::current at whichever node it is running or delivering to.
+
+struct esp_now_send_info_t;
+struct esp_now_recv_info_t;
+enum esp_now_send_status_t : int;
+typedef void (*esp_now_send_cb_t)(const esp_now_send_info_t*, esp_now_send_status_t);
+typedef void (*esp_now_recv_cb_t)(const esp_now_recv_info_t*, const uint8_t*, int);
+
+namespace sim {
+
+struct NodeContext {
+  std::string name;
+  uint8_t mac[6]{};
+  int channel{1};
+  bool sta_started{false};
+  bool asleep{false};
+
+  // station connection to the simulated access point, if this node has one
+  bool has_ap{false};
+  int ap_channel{1};
+  unsigned long connect_ms{0};
+  bool wifi_begun{false};
+  uint64_t wifi_begin_us{0};
+
+  esp_now_send_cb_t send_cb{nullptr};
+  esp_now_recv_cb_t recv_cb{nullptr};
+  std::vector<std::function<void(int)>> wifi_event_cbs;
+
+  // called before any code runs on behalf of this node, eg to rebind singletons
+  std::function<void()> bind;
+
+  // radio accounting
+  uint64_t tx_frames{0};
+  uint64_t tx_bytes{0};
+  uint64_t airtime_us{0};
+  uint64_t channel_changes{0};
+};
+
+// virtual clock, only ever moved forward by the harness
+inline uint64_t now_us = 0;
+inline NodeContext* current = nullptr;
+
+// set by the harness: puts a frame sent by the current node on the air
+inline std::function<void(NodeContext&, const uint8_t*, int)> transmit;
+// set by the harness: runs fn at the given time, on behalf of node
+inline std::function<void(uint64_t, NodeContext&, std::function<void()>)> schedule;
+
+inline void enter(NodeContext& node) {
+  current = &node;
+  if (node.bind)
+    node.bind();
+}
+
+inline bool wifi_connected(const NodeContext& node) {
+  return node.has_ap && node.wifi_begun && now_us >= node.wifi_begin_us + node.connect_ms * 1000;
+}
+
+}  // namespace sim
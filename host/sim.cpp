@@ -0,0 +1,440 @@
+/// Discrete-event simulation of battery temperature sensors talking to one relay over
+/// a simulated ESP-NOW medium, running the real state machines from ../Mitsubino on
+/// the stand-in HAL in hal/. Sensors behave like the firmware with sleep enabled: wake,
+/// send one reading to the relay, wait for the response and go back to deep sleep.
+/// The relay answers like the firmware does, forwards each reading to the broker and
+/// fans it out along the --routes table (same format as the relay's routes setting).
+///
+/// Usage: mitsubino_sim [--sensors=N] [--loss=P] [--latency-us=US] [--jitter-us=US]
+///                      [--relay-channel=C] [--sensor-channel=C] [--sleep-ms=MS]
+///                      [--boot-ms=MS] [--wifi-connect-ms=MS] [--give-up-ms=MS]
+///                      [--duration-s=S] [--seed=N] [--routes=CONFIG] [--verbose]
+
+#include <cinttypes>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+
+#include "Logger.h"
+#include "PersistentData.h"
+#include "WifiStates.h"
+#include "MQTTClient.h"
+#include "ESPNOWMsg.h"
+#include "Routes.h"
+
+void handle_mqtt_message(char* topic, byte* payload, unsigned int length) {}
+
+struct Config {
+  int sensors = 5;
+  double loss = 0.05;                  // per frame, per receiver
+  unsigned long latency_us = 500;      // on top of airtime
+  unsigned long jitter_us = 300;
+  int relay_channel = 6;               // channel of the relay's access point
+  int sensor_channel = 1;              // channel sensors try first after a reset
+  unsigned long sleep_ms = 5000;       // deep sleep between wakes, as in the firmware
+  unsigned long boot_ms = 0;           // wake from deep sleep until loop() runs
+  unsigned long wifi_connect_ms = 2000;
+  unsigned long give_up_ms = 10000;    // the firmware never gives up, the simulator does
+  double duration_s = 600;
+  unsigned seed = 1;
+  std::string routes;
+  bool verbose = false;
+};
+
+static bool parse_args(int argc, char** argv, Config& cfg) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--verbose") {
+      cfg.verbose = true;
+      continue;
+    }
+    size_t eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      fprintf(stderr, "bad argument: %s\n", argv[i]);
+      return false;
+    }
+    std::string key = arg.substr(2, eq - 2);
+    const char* v = arg.c_str() + eq + 1;
+    if (key == "sensors") cfg.sensors = atoi(v);
+    else if (key == "loss") cfg.loss = atof(v);
+    else if (key == "latency-us") cfg.latency_us = strtoul(v, nullptr, 10);
+    else if (key == "jitter-us") cfg.jitter_us = strtoul(v, nullptr, 10);
+    else if (key == "relay-channel") cfg.relay_channel = atoi(v);
+    else if (key == "sensor-channel") cfg.sensor_channel = atoi(v);
+    else if (key == "sleep-ms") cfg.sleep_ms = strtoul(v, nullptr, 10);
+    else if (key == "boot-ms") cfg.boot_ms = strtoul(v, nullptr, 10);
+    else if (key == "wifi-connect-ms") cfg.wifi_connect_ms = strtoul(v, nullptr, 10);
+    else if (key == "give-up-ms") cfg.give_up_ms = strtoul(v, nullptr, 10);
+    else if (key == "duration-s") cfg.duration_s = atof(v);
+    else if (key == "seed") cfg.seed = strtoul(v, nullptr, 10);
+    else if (key == "routes") cfg.routes = v;
+    else {
+      fprintf(stderr, "unknown option: --%s\n", key.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+class EventQueue {
+  struct Event {
+    uint64_t at;
+    uint64_t seq;
+    std::function<void()> fn;
+    bool operator>(const Event& e) const {
+      return at != e.at ? at > e.at : seq > e.seq;
+    }
+  };
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> queue_;
+  uint64_t seq_{0};
+
+public:
+  void push(uint64_t at, std::function<void()> fn) {
+    queue_.push({at, seq_++, std::move(fn)});
+  }
+
+  uint64_t next_time() const {
+    return queue_.empty() ? UINT64_MAX : queue_.top().at;
+  }
+
+  // runs everything due at or before now
+  void run_until(uint64_t now) {
+    while (!queue_.empty() && queue_.top().at <= now) {
+      auto fn = queue_.top().fn;
+      queue_.pop();
+      fn();
+    }
+  }
+};
+
+struct Stats {
+  uint64_t wakes{0};
+  uint64_t delivered{0};
+  uint64_t timed_out{0};
+  uint64_t frames_lost{0};
+  uint64_t relay_duplicates{0};
+  uint64_t publishes{0};
+  uint64_t routed{0};
+  std::vector<double> ack_latency_ms;
+  std::vector<double> e2e_latency_ms;
+  std::vector<double> awake_ms;
+  std::vector<double> retries;
+  std::vector<double> hops;
+  std::vector<double> airtime_us;
+  // first transmission of each reading, keyed by sender and seqnum
+  std::map<std::pair<std::string, uint32_t>, uint64_t> sent_at;
+};
+
+static Config g_cfg;
+static Stats g_stats;
+static EventQueue g_events;
+static std::mt19937 g_rng;
+
+// one simulated device: its own radio/WiFi context, logger and scheduler
+struct Node {
+  sim::NodeContext ctx;
+  Logger logger{4096};
+  Scheduler scheduler;
+
+  Node(const std::string& name, uint8_t id) {
+    ctx.name = name;
+    uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, id};
+    memcpy(ctx.mac, mac, 6);
+    logger.set_serial(g_cfg.verbose);
+  }
+  virtual ~Node() = default;
+
+  // one pass of loop(), with sim::current already pointing at us
+  virtual void step() = 0;
+
+  uint64_t next_due_us() const {
+    if (ctx.asleep)
+      return UINT64_MAX;
+    unsigned long wait = scheduler.ms_until_due(Scheduler::FOREVER);
+    if (wait == 0)
+      return sim::now_us;
+    if (wait == Scheduler::FOREVER)
+      return UINT64_MAX;
+    return (uint64_t)(millis() + wait) * 1000;
+  }
+};
+
+struct SensorNode : Node {
+  std::unique_ptr<ESPNOWStateMachine> espnow;
+  int rtc_channel;
+  uint32_t seqnum{0};
+  bool sent{false};
+  uint64_t wake_us{0};
+  uint64_t send_us{0};
+  uint64_t airtime_at_wake{0};
+  uint64_t hops_at_wake{0};
+
+  SensorNode(const std::string& name, uint8_t id) : Node(name, id), rtc_channel(g_cfg.sensor_channel) {
+    ctx.asleep = true;
+    ctx.bind = [this] {
+      if (espnow)
+        espnow->bindCallbacks();
+    };
+  }
+
+  void wake() {
+    wake_us = sim::now_us;
+    g_stats.wakes++;
+    g_events.push(sim::now_us + g_cfg.boot_ms * 1000, [this] {
+      sim::enter(ctx);
+      ctx.asleep = false;
+      airtime_at_wake = ctx.airtime_us;
+      hops_at_wake = ctx.channel_changes;
+      sent = false;
+      seqnum++;
+      espnow = std::make_unique<ESPNOWStateMachine>(&logger, String(ctx.name.c_str()), false, rtc_channel);
+      scheduler.adopt(*espnow);
+    });
+  }
+
+  void sleep(bool delivered) {
+    uint64_t now = sim::now_us;
+    g_stats.awake_ms.push_back((now - wake_us) / 1000.0);
+    g_stats.airtime_us.push_back(ctx.airtime_us - airtime_at_wake);
+    g_stats.hops.push_back(ctx.channel_changes - hops_at_wake);
+    if (delivered) {
+      g_stats.delivered++;
+      g_stats.ack_latency_ms.push_back((now - send_us) / 1000.0);
+      g_stats.retries.push_back(espnow->numAttempts() - 1);
+    }
+    else {
+      g_stats.timed_out++;
+    }
+    rtc_channel = espnow->getChannel();
+    espnow.reset();
+    ctx.asleep = true;
+    ctx.sta_started = false;
+    ctx.send_cb = nullptr;
+    ctx.recv_cb = nullptr;
+    g_events.push(now + g_cfg.sleep_ms * 1000, [this] { wake(); });
+  }
+
+  void step() override {
+    scheduler.run_due();
+    while (espnow->hasReceived()) {
+      auto msg = espnow->getReceived();
+      if (msg.type == ReceivedMessage::Type::Response) {
+        sleep(true);
+        return;
+      }
+    }
+    if (!sent && espnow->canSend()) {
+      MsgMQTTRelay msg{};
+      msg.sender = String(ctx.name.c_str());
+      msg.recipient = "hp_relay";
+      msg.seqnum = seqnum;
+      msg.body = String("{\"temperature\":21.5,\"humidity\":40.0}");
+      const char* mstart = (const char*)&msg;
+      espnow->sendMessage(String(mstart, sizeof(msg)));
+      sent = true;
+      send_us = sim::now_us;
+      g_stats.sent_at.emplace(std::make_pair(ctx.name, seqnum), send_us);
+    }
+    if (sim::now_us - wake_us > g_cfg.give_up_ms * 1000) {
+      sleep(false);
+    }
+  }
+};
+
+struct RelayNode : Node {
+  std::unique_ptr<WifiClientStateMachine> wifi;
+  std::unique_ptr<MQTTStateMachine> mqtt;
+  std::unique_ptr<ESPNOWStateMachine> espnow;
+  RoutingTable routes{&logger};
+
+  RelayNode() : Node("hp_relay", 1) {
+    ctx.has_ap = true;
+    ctx.ap_channel = g_cfg.relay_channel;
+    ctx.connect_ms = g_cfg.wifi_connect_ms;
+    ctx.bind = [this] {
+      if (espnow)
+        espnow->bindCallbacks();
+    };
+    sim::enter(ctx);
+    wifi = std::make_unique<WifiClientStateMachine>(&logger, "hp_relay", "ssid", "password");
+    mqtt = std::make_unique<MQTTStateMachine>(&logger, "hp_relay", "broker", "user", "password", 1883);
+    espnow = std::make_unique<ESPNOWStateMachine>(&logger, "hp_relay", true, g_cfg.relay_channel);
+    scheduler.adopt(*wifi);
+    scheduler.adopt(*mqtt);
+    scheduler.adopt(*espnow);
+    routes.parse(g_cfg.routes);
+  }
+
+  void step() override {
+    scheduler.run_due();
+    while (espnow->hasReceived()) {
+      auto msg = espnow->getReceived();
+      if (msg.type != ReceivedMessage::Type::Unicast)
+        continue;
+      MsgMQTTRelay response{};
+      response.sender = "hp_relay";
+      response.recipient = msg->sender;
+      response.seqnum = msg->seqnum;
+      response.body = String("ack");
+      const char* mstart = (const char*)&response;
+      espnow->sendResponse(String(mstart, sizeof(response)));
+
+      std::string sender(msg->sender.data.data());
+      if (const RoutingTable::Route* route = routes.find(msg->sender))
+        g_stats.routed += route->count;
+      auto publish = [this](const char* topic, const String& payload, bool retain) {
+        return mqtt->publish(topic, payload.c_str(), retain);
+      };
+      if (!routes.forward(msg->sender, String(msg.body().c_str()), publish, *espnow))
+        continue;
+      auto it = g_stats.sent_at.find(std::make_pair(sender, (uint32_t)msg->seqnum));
+      if (it == g_stats.sent_at.end()) {
+        g_stats.relay_duplicates++;
+        continue;
+      }
+      g_stats.e2e_latency_ms.push_back((sim::now_us - it->second) / 1000.0);
+      g_stats.sent_at.erase(it);
+    }
+  }
+};
+
+static std::vector<std::unique_ptr<Node>> g_nodes;
+
+// ESP-NOW at the default 1 Mbps: long preamble plus MAC/vendor action frame overhead
+static uint64_t airtime_us(int len) {
+  return 192 + (uint64_t)(len + 43) * 8;
+}
+
+static void transmit(sim::NodeContext& sender, const uint8_t* data, int len) {
+  uint64_t air = airtime_us(len);
+  sender.tx_frames++;
+  sender.tx_bytes += len;
+  sender.airtime_us += air;
+  int channel = sender.channel;
+  auto frame = std::make_shared<std::string>((const char*)data, len);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (auto& node : g_nodes) {
+    sim::NodeContext* rx = &node->ctx;
+    if (rx == &sender)
+      continue;
+    if (uniform(g_rng) < g_cfg.loss) {
+      g_stats.frames_lost++;
+      continue;
+    }
+    uint64_t at = sim::now_us + air + g_cfg.latency_us + (uint64_t)(uniform(g_rng) * g_cfg.jitter_us);
+    esp_now_recv_info_t info{};
+    memcpy(info.src_addr, sender.mac, 6);
+    g_events.push(at, [rx, channel, frame, info] {
+      if (rx->asleep || rx->channel != channel || !rx->recv_cb)
+        return;
+      sim::enter(*rx);
+      rx->recv_cb(&info, (const uint8_t*)frame->data(), frame->size());
+    });
+  }
+  sim::NodeContext* tx = &sender;
+  g_events.push(sim::now_us + air, [tx] {
+    if (tx->asleep || !tx->send_cb)
+      return;
+    sim::enter(*tx);
+    esp_now_send_info_t info{};
+    tx->send_cb(&info, ESP_NOW_SEND_SUCCESS);
+  });
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  size_t i = (size_t)std::ceil(p * v.size());
+  return v[std::min(v.size() - 1, i ? i - 1 : 0)];
+}
+
+static double mean(const std::vector<double>& v) {
+  double sum = 0;
+  for (double x : v)
+    sum += x;
+  return v.empty() ? 0 : sum / v.size();
+}
+
+static void print_distribution(const char* label, const std::vector<double>& v, const char* unit) {
+  printf("%-28s p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f %s  (n=%zu)\n", label,
+         percentile(v, 0.5), percentile(v, 0.9), percentile(v, 0.99), percentile(v, 1.0), unit, v.size());
+}
+
+int main(int argc, char** argv) {
+  if (!parse_args(argc, argv, g_cfg))
+    return 2;
+  g_rng.seed(g_cfg.seed);
+
+  Logger transitions_logger{4096};
+  transitions_logger.set_serial(g_cfg.verbose);
+  CRTPBase::logger_ = g_cfg.verbose ? &transitions_logger : nullptr;
+
+  sim::transmit = transmit;
+  sim::schedule = [](uint64_t at, sim::NodeContext& node, std::function<void()> fn) {
+    g_events.push(at, [&node, fn] {
+      sim::enter(node);
+      fn();
+    });
+  };
+  sim::broker.on_publish = [](const std::string&, const std::string&, const std::string&) { g_stats.publishes++; };
+
+  g_nodes.push_back(std::make_unique<RelayNode>());
+  // stagger the first wakes across one sleep period
+  std::uniform_int_distribution<unsigned long> offset(0, g_cfg.sleep_ms * 1000);
+  for (int i = 0; i < g_cfg.sensors; i++) {
+    auto sensor = std::make_unique<SensorNode>("remote_temp_" + std::to_string(i + 1), 2 + i);
+    SensorNode* s = sensor.get();
+    g_events.push(offset(g_rng), [s] { s->wake(); });
+    g_nodes.push_back(std::move(sensor));
+  }
+
+  const uint64_t end_us = (uint64_t)(g_cfg.duration_s * 1e6);
+  while (sim::now_us < end_us) {
+    // run every node that is due, like successive passes of loop()
+    bool busy = false;
+    for (int pass = 0; pass < 1000; pass++) {
+      busy = false;
+      for (auto& node : g_nodes) {
+        if (node->next_due_us() <= sim::now_us) {
+          sim::enter(node->ctx);
+          node->step();
+          busy = true;
+        }
+      }
+      if (!busy)
+        break;
+    }
+    uint64_t next = g_events.next_time();
+    for (auto& node : g_nodes)
+      next = std::min(next, node->next_due_us());
+    // a task that never declares a deadline gets polled every ms
+    if (busy)
+      next = std::max(next, sim::now_us + 1000);
+    if (next == UINT64_MAX || next > end_us)
+      break;
+    sim::now_us = std::max(sim::now_us, next);
+    g_events.run_until(sim::now_us);
+  }
+  sim::now_us = end_us;
+
+  uint64_t sensor_frames = 0;
+  for (size_t i = 1; i < g_nodes.size(); i++)
+    sensor_frames += g_nodes[i]->ctx.tx_frames;
+
+  printf("simulated %.0f s: %d sensors, loss %.1f%%, latency %lu+%lu us, relay on channel %d\n",
+         g_cfg.duration_s, g_cfg.sensors, g_cfg.loss * 100, g_cfg.latency_us, g_cfg.jitter_us, g_cfg.relay_channel);
+  printf("wakes %" PRIu64 ", delivered %" PRIu64 ", gave up %" PRIu64 ", relay duplicates %" PRIu64 ", MQTT publishes %" PRIu64 ", routed %" PRIu64 "\n",
+         g_stats.wakes, g_stats.delivered, g_stats.timed_out, g_stats.relay_duplicates, g_stats.publishes, g_stats.routed);
+  printf("frames sent: sensors %" PRIu64 ", relay %" PRIu64 ", lost %" PRIu64 "\n",
+         sensor_frames, g_nodes[0]->ctx.tx_frames, g_stats.frames_lost);
+  print_distribution("ACK latency", g_stats.ack_latency_ms, "ms");
+  print_distribution("sensor -> MQTT latency", g_stats.e2e_latency_ms, "ms");
+  print_distribution("awake time per wake", g_stats.awake_ms, "ms");
+  print_distribution("airtime per wake", g_stats.airtime_us, "us");
+  printf("%-28s mean %6.2f  max %6.0f\n", "retries per delivery", mean(g_stats.retries), percentile(g_stats.retries, 1.0));
+  printf("%-28s mean %6.2f  max %6.0f\n", "channel hops per wake", mean(g_stats.hops), percentile(g_stats.hops, 1.0));
+  return 0;
+}